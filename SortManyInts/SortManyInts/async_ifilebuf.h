@@ -9,8 +9,10 @@
 #include <fstream>
 #include <mutex>
 #include <streambuf>
+#include <string>
 #include <thread>
 #include <vector>
+#include "numa_node.h"
 
 struct async_ifilebuf : std::streambuf
 {
@@ -27,7 +29,8 @@ struct async_ifilebuf : std::streambuf
 	bool destroy = false;
 	std::thread thread;
 
-	void worker(const char* name, std::ios_base::openmode mode = std::ios_base::in) {
+	void worker(std::string name, std::ios_base::openmode mode = std::ios_base::in, int numa_node = -1) {
+		numa_pin_thread(numa_node);
 		auto is_empty_predicate = [this]() { return this->swap_buffer.empty() || this->destroy; };
 		in.open(name, mode);
 		while (!destroy) {
@@ -36,9 +39,9 @@ struct async_ifilebuf : std::streambuf
 				condition.wait(guard, is_empty_predicate);
 				filling_buffer.swap(swap_buffer);
 				if (in.eof()) fill_eof = true;
-				if (destroy || fill_eof) break;
 			}
 			condition.notify_one();
+			if (destroy || fill_eof) break;
 			filling_buffer.resize(buffer_dump_size);
 			in.read(filling_buffer.data(), filling_buffer.size());
 			filling_buffer.resize(in.gcount());
@@ -46,25 +49,26 @@ struct async_ifilebuf : std::streambuf
 		in.close();
 	}
 public:
-	async_ifilebuf(const char* name, std::ios_base::openmode mode = std::ios_base::out)
-		: thread(&worker, this, name, mode) {
+	async_ifilebuf(const char* name, std::ios_base::openmode mode = std::ios_base::out, int numa_node = -1)
+		: thread(&worker, this, std::string(name), mode, numa_node) {
 		setg(dumping_buffer.data(), dumping_buffer.data(), dumping_buffer.data() + dumping_buffer.size());
 	}
 	~async_ifilebuf() {
 		{
-			std::unique_lock<std::mutex>(mutex);
+			std::unique_lock<std::mutex> guard(mutex);
 			destroy = true;
 		}
 		condition.notify_one();
 		thread.join();
 	}
 	int underflow() {
-		if (eback() == gptr()) {
+		if (gptr() == egptr()) {
 			if (dump_eof) return std::char_traits<char>::eof();
 			auto has_data_predicate = [this]() {return !this->swap_buffer.empty() || this->destroy || this->fill_eof; };
 			{
 				std::unique_lock<std::mutex> guard(mutex);
 				condition.wait(guard, has_data_predicate);
+				dumping_buffer.clear();
 				dumping_buffer.swap(swap_buffer);
 				if (dumping_buffer.empty() && fill_eof) {
 					dump_eof = true;
@@ -74,6 +78,6 @@ public:
 			condition.notify_one();
 			setg(dumping_buffer.data(), dumping_buffer.data(), dumping_buffer.data() + dumping_buffer.size());
 		}
-		return (unsigned) *gptr();
+		return std::char_traits<char>::to_int_type(*gptr());
 	}
 };
\ No newline at end of file
@@ -13,8 +13,10 @@
 #include <fstream>
 #include <mutex>
 #include <streambuf>
+#include <string>
 #include <thread>
 #include <vector>
+#include "numa_node.h"
 
 struct async_ofilebuf : std::streambuf
 {
@@ -30,7 +32,8 @@ struct async_ofilebuf : std::streambuf
 	bool destroy = false;
 	std::thread thread;
 
-	void worker(const char* name, std::ios_base::openmode mode = std::ios_base::out) {
+	void worker(std::string name, std::ios_base::openmode mode = std::ios_base::out, int numa_node = -1) {
+		numa_pin_thread(numa_node);
 		auto has_bytes_predicate = [this]() { return !this->swap_buffer.empty() || this->destroy;};
 		out.open(name, mode);
 		bool local_done = false;
@@ -69,15 +72,15 @@ struct async_ofilebuf : std::streambuf
 		}
 	}
 public:
-	async_ofilebuf(const char* name, std::ios_base::openmode mode = std::ios_base::out)
+	async_ofilebuf(const char* name, std::ios_base::openmode mode = std::ios_base::out, int numa_node = -1)
 		: filling_buffer(buffer_dump_size)
-		, thread(&worker, this, name, mode) {
+		, thread(&worker, this, std::string(name), mode, numa_node) {
 		setp(filling_buffer.data(), filling_buffer.data() + filling_buffer.size() - 1);
 	}
 	~async_ofilebuf() {
 		dump(false);
 		{
-			std::unique_lock<std::mutex>(mutex);
+			std::unique_lock<std::mutex> guard(mutex);
 			destroy = true;
 		}
 		condition.notify_one();
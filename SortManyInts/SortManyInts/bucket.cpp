@@ -1,10 +1,15 @@
-
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <vector>
+#include <boost/exception/all.hpp>
 #include "async_ifilebuf.h"
 #include "async_ofilebuf.h"
+#include "numa_node.h"
 #include "sorter.h"
+#undef min
 
 namespace po = boost::program_options;
 namespace fs = std::filesystem;
@@ -15,29 +20,40 @@ struct write_bucket {
 	fs::path filename;
 	async_ofilebuf filebuf;
 	std::ostream out;
-	write_bucket(fs::path filename)
+	write_bucket(fs::path filename, int numa_node)
 		: filename(filename)
-		, filebuf(filename.string().c_str(), std::ios_base::binary)
+		, filebuf(filename.string().c_str(), std::ios_base::binary, numa_node)
 		, out(&filebuf)
 	{}
 };
 
+//one node-local vector per NUMA node, each holding a contiguous slice of the bucket's key range
+typedef std::vector<numa_vector<unsigned long long>> memory_bucket;
+
+//the key space is cut into bucket_count * node_count equal slots. A bucket is node_count consecutive slots,
+//so within a bucket, slot % node_count says which node owns the key.
+unsigned long long key_slot(unsigned long long v, unsigned long long slot_count) {
+	return std::min(v / (ULLONG_MAX / slot_count), slot_count - 1);
+}
+
 constexpr int buff_longs = 4096 * 2 / sizeof(long long);
-void emputten_bucket(const std::vector<unsigned long long>& buffer, unsigned long long bucket_count, unsigned long long bucket_range, std::vector<unsigned long long>& first_bucket, std::vector<write_bucket>& write_buckets) {
+void emputten_bucket(const std::vector<unsigned long long>& buffer, unsigned long long slot_count, memory_bucket& first_bucket, std::deque<write_bucket>& write_buckets) {
+	unsigned long long node_count = first_bucket.size();
 	for (unsigned long long v : buffer) {
-		int bucket_idx = v / bucket_range;
+		unsigned long long slot = key_slot(v, slot_count);
+		unsigned long long bucket_idx = slot / node_count;
 		if (bucket_idx == 0) {
-			first_bucket.push_back(v);
+			first_bucket[slot % node_count].push_back(v);
 		}
 		else {
-			assert(bucket_idx < write_buckets.size());
-			write_buckets[bucket_idx].out.write((const char*)&v, sizeof(unsigned long long));
+			assert(bucket_idx - 1 < write_buckets.size());
+			write_buckets[bucket_idx - 1].out.write((const char*)&v, sizeof(unsigned long long));
 		}
 	}
 }
 
-bool load_buckets(const fs::path& in_path, unsigned long long filesize, unsigned long long bucket_count, unsigned long long bucket_range, std::vector<unsigned long long>& first_bucket, std::vector<write_bucket>& write_buckets) {
-	async_ifilebuf in_buf(in_path.string().c_str(), std::ios::binary);
+bool load_buckets(const fs::path& in_path, unsigned long long filesize, unsigned long long slot_count, memory_bucket& first_bucket, std::deque<write_bucket>& write_buckets, int home_node) {
+	async_ifilebuf in_buf(in_path.string().c_str(), std::ios::binary, home_node);
 	std::istream in(&in_buf);
 	std::cout << "filling buckets...\n";
 	std::vector<unsigned long long> buffer(buff_longs);
@@ -55,7 +71,7 @@ bool load_buckets(const fs::path& in_path, unsigned long long filesize, unsigned
 				return false;
 			}
 			else {
-				emputten_bucket(buffer, bucket_count, bucket_range, first_bucket, write_buckets);
+				emputten_bucket(buffer, slot_count, first_bucket, write_buckets);
 			}
 			longs_this_dot += read_count;
 		} while (longs_this_dot < stop);
@@ -66,18 +82,92 @@ bool load_buckets(const fs::path& in_path, unsigned long long filesize, unsigned
 	return true;
 }
 
+bool reload_bucket(const fs::path& filename, unsigned long long slot_count, memory_bucket& bucket, int home_node) {
+	unsigned long long node_count = bucket.size();
+	async_ifilebuf in_buf(filename.string().c_str(), std::ios::binary, home_node);
+	std::istream in(&in_buf);
+	std::vector<unsigned long long> buffer(buff_longs);
+	unsigned long long remaining_longs = fs::file_size(filename) / sizeof(unsigned long long);
+	while (remaining_longs) {
+		unsigned long long read_count = std::min((unsigned long long)buff_longs, remaining_longs);
+		in.read((char*)buffer.data(), read_count * sizeof(unsigned long long));
+		if (in.gcount() < read_count * sizeof(unsigned long long)) {
+			std::cerr << "\nfailed to read from " << filename << '\n';
+			return false;
+		}
+		for (unsigned long long i = 0; i < read_count; i++)
+			bucket[key_slot(buffer[i], slot_count) % node_count].push_back(buffer[i]);
+		remaining_longs -= read_count;
+	}
+	return true;
+}
+
+//each node sorts its own key range, from its own memory, on its own processors
+void sort_bucket(memory_bucket& bucket) {
+	std::vector<std::thread> node_sorters;
+	for (int node = 0; node < int(bucket.size()); node++) {
+		node_sorters.emplace_back([&bucket, node]() {
+			numa_pin_thread(node);
+			std::sort(bucket[node].begin(), bucket[node].end());
+		});
+	}
+	for (std::thread& node_sorter : node_sorters)
+		node_sorter.join();
+}
+
+void write_bucket_out(memory_bucket& bucket, std::ostream& out) {
+	for (numa_vector<unsigned long long>& keys : bucket) {
+		out.write((const char*)keys.data(), keys.size() * sizeof(unsigned long long));
+		keys.clear();
+	}
+	std::cout << '.' << std::flush;
+}
+
 sorter_output bucket(const fs::path& in_path, unsigned long long filesize, const fs::path& out_path, po::variables_map& arguments) {
-	unsigned long long total_memory = getTotalSystemMemory();
-	unsigned long long bucket_size = total_memory / 4 / sizeof(long long); // 4 -> read bucket, sort bucket, write bucket, and slop for OS
-	unsigned long long bucket_count = (filesize + bucket_size - 1) / bucket_size;
-	unsigned long long bucket_range = ULLONG_MAX / bucket_count + 1;
-	unsigned long long file_bucket_count = bucket_count - 1;
-	std::vector<unsigned long long> first_bucket;
-	first_bucket.reserve(bucket_size + bucket_size / 2);
-	std::vector<write_bucket> write_buckets;
-	write_buckets.reserve(file_bucket_count);
-	for (int i = 0; i < file_bucket_count; i++) {
-		fs::path filename = fs::temp_directory_path().append(IN_FILENAME + std::to_string(i) + ".bin");
-		write_buckets.emplace_back(filename);
+	try {
+		unsigned long long total_memory = getTotalSystemMemory();
+		unsigned long long bucket_size = total_memory / 4 / sizeof(long long); // 4 -> read bucket, sort bucket, write bucket, and slop for OS
+		unsigned long long bucket_count = std::max((filesize / sizeof(long long) + bucket_size - 1) / bucket_size, 1ull);
+		int node_count = numa_node_count();
+		unsigned long long slot_count = bucket_count * node_count;
+		//this thread does all the reading and bucketing, so keep it, and the I/O threads that feed and drain it,
+		//on the node it started on until the sort is done
+		int home_node = numa_current_node();
+		numa_thread_pin pin(home_node);
+		memory_bucket first_bucket;
+		first_bucket.reserve(node_count);
+		for (int node = 0; node < node_count; node++) {
+			first_bucket.emplace_back(numa_allocator<unsigned long long>(node));
+			first_bucket.back().reserve((bucket_size + bucket_size / 2) / node_count);
+		}
+		std::vector<fs::path> filenames;
+		{
+			std::deque<write_bucket> write_buckets;
+			for (unsigned long long i = 1; i < bucket_count; i++) {
+				filenames.push_back(fs::temp_directory_path().append(IN_FILENAME + std::to_string(i) + ".bin"));
+				write_buckets.emplace_back(filenames.back(), home_node);
+			}
+			if (!load_buckets(in_path, filesize, slot_count, first_bucket, write_buckets, home_node))
+				return sorter_fail;
+		}
+
+		async_ofilebuf out_buf(out_path.string().c_str(), std::ios_base::binary, home_node);
+		std::ostream out(&out_buf);
+		out.exceptions(~std::ios::goodbit);
+		std::cout << "sorting " << bucket_count << " buckets on " << node_count << " nodes...\n";
+		sort_bucket(first_bucket);
+		write_bucket_out(first_bucket, out);
+		for (const fs::path& filename : filenames) {
+			if (!reload_bucket(filename, slot_count, first_bucket, home_node))
+				return sorter_fail;
+			fs::remove(filename);
+			sort_bucket(first_bucket);
+			write_bucket_out(first_bucket, out);
+		}
+		std::cout << '\n';
+		return sorter_sorted;
+	}
+	catch (std::ios_base::failure e) {
+		BOOST_THROW_EXCEPTION(boost::enable_error_info(e) << boost::errinfo_file_name(in_path.string()));
 	}
-}
\ No newline at end of file
+}
@@ -8,6 +8,7 @@
 #include <boost/exception/all.hpp>
 #include <boost/iterator/transform_iterator.hpp>
 #include "async_ofilebuf.h"
+#include "fence_index.h"
 #include "sorter.h"
 #include "rand_sse.h"
 #ifdef _MSC_VER 
@@ -22,6 +23,7 @@ namespace fs = std::filesystem;
 
 const char HELP_NAME[] = "help";
 const char SORTER_NAME[] = "sorter";
+const char NO_PRESORT_NAME[] = "no-presort";
 
 const char IN_FILENAME[] = "random.bin";
 const char OUT_FILENAME[] = "sorted.bin";
@@ -47,7 +49,8 @@ po::options_description get_options_description() {
 	po::options_description desc("Allowed options");
 	desc.add_options()
 		(HELP_NAME, "produce help message")
-		(SORTER_NAME, po::value<std::string>());
+		(SORTER_NAME, po::value<std::string>())
+		(NO_PRESORT_NAME, "skip the presortedness probe and always run the sorter");
 	return desc;
 }
 
@@ -74,9 +77,10 @@ bool is_sorted(const fs::path& in_path, unsigned long long filesize) {
 		unsigned long long min = 0;
 		unsigned long long next = ULLONG_MIN;
 		std::cout << "verifying shuffled file...\n";
-		unsigned long long dot_offset = filesize / 79;
+		unsigned long long remaining_longs = filesize / sizeof(unsigned long long);
+		unsigned long long dot_offset = remaining_longs / 79;
 		do {
-			unsigned long long stop = std::min(dot_offset, filesize);
+			unsigned long long stop = std::min(dot_offset, remaining_longs);
 			for (unsigned long long i = 0; i < stop; i++) {
 				stream.read((char*)&next, sizeof(unsigned long long));
 				if (next < min || stream.gcount() != sizeof(unsigned long long)) {
@@ -85,9 +89,9 @@ bool is_sorted(const fs::path& in_path, unsigned long long filesize) {
 				}
 				min = next;
 			}
-			filesize -= stop;
+			remaining_longs -= stop;
 			std::cout << '.' << std::flush;
-		} while (filesize);
+		} while (remaining_longs);
 		std::cout << '\n';
 		return true;
 	} catch (std::ifstream::failure e) {
@@ -95,6 +99,40 @@ bool is_sorted(const fs::path& in_path, unsigned long long filesize) {
 	}
 }
 
+//spot checks contains/range against the keys actually in the output, if the sorter emitted a fence index for it
+bool is_index_consistent(const fs::path& out_path, unsigned long long filesize) {
+	if (!fs::exists(fence_index_path(out_path))) return true;
+	try {
+		std::cout << "verifying fence index...\n";
+		sorted_file sorted(out_path);
+		std::ifstream stream{ out_path.c_str(), std::ios_base::binary };
+		stream.exceptions(~std::ios::goodbit);
+		unsigned long long key_count = filesize / sizeof(unsigned long long);
+		unsigned long long probes = std::min(key_count, 1024ull);
+		for (unsigned long long i = 0; i < probes; i++) {
+			unsigned long long position = key_count * i / probes;
+			unsigned long long key;
+			stream.seekg(position * sizeof(unsigned long long));
+			stream.read((char*)&key, sizeof(unsigned long long));
+			key_range equal = sorted.range(key, key);
+			bool ok = sorted.contains(key) && equal.begin() <= sorted.keys + position && sorted.keys + position < equal.end();
+			if (ok && position + 1 < key_count) {
+				unsigned long long next;
+				stream.read((char*)&next, sizeof(unsigned long long));
+				if (next - key > 1)
+					ok = !sorted.contains(key + 1) && sorted.range(key + 1, next - 1).empty();
+			}
+			if (!ok) {
+				std::cout << out_path << " fence index lookup failed for " << key << '\n';
+				return false;
+			}
+		}
+		return true;
+	} catch (std::ifstream::failure e) {
+		BOOST_THROW_EXCEPTION(boost::enable_error_info(e) << boost::errinfo_file_name(out_path.string()));
+	}
+}
+
 void create_input_file(const fs::path& in_path, unsigned long long filesize) {
 	try {
 		{
@@ -184,6 +222,8 @@ fs::path choose_and_prepare_output_file() {
 		std::ofstream ensure_wriable(out_path.c_str(), std::ios_base::binary);
 		ensure_wriable.exceptions(~std::ios::goodbit);
 		ensure_wriable.write("\0", 1);
+		//a fence index left over from an earlier run would describe some other output
+		fs::remove(fence_index_path(out_path));
 		return out_path;
 	} catch (std::ofstream::failure e) {
 		BOOST_THROW_EXCEPTION(boost::enable_error_info(e) << boost::errinfo_file_name(out_path.string()));
@@ -193,7 +233,7 @@ fs::path choose_and_prepare_output_file() {
 int write_results(const fs::path out_path, unsigned long long filesize, std::chrono::time_point<std::chrono::steady_clock> start) {
 	auto finish = std::chrono::high_resolution_clock::now();
 #ifdef _DEBUG
-	if (!is_sorted(out_path, filesize))
+	if (!is_sorted(out_path, filesize) || !is_index_consistent(out_path, filesize))
 		return EXIT_FAILURE;
 #endif
 	std::chrono::duration<float> elapsed = finish - start;
@@ -211,6 +251,12 @@ int write_results(const fs::path out_path, unsigned long long filesize, std::chr
 	return EXIT_SUCCESS;
 }
 
+sorter_output run_sorter(sorter* sorter, const fs::path& in_path, unsigned long long filesize, const fs::path& out_path, po::variables_map& arguments) {
+	if (!arguments.count(NO_PRESORT_NAME) && sort_presorted(in_path, filesize, out_path))
+		return sorter_sorted;
+	return (*sorter)(in_path, filesize, out_path, arguments);
+}
+
 #ifdef _DEBUG
 const int DEBUG_FRACTION = 1024;
 #else
@@ -229,17 +275,17 @@ int do_test(const std::unordered_map<std::string, sorter*>& sorters, po::variabl
 
 	std::cout << "warming up...\n";
 	try {
-		sorter_output sorted = (*sorter)(in_path, filesize, out_path, arguments);
+		sorter_output sorted = run_sorter(sorter, in_path, filesize, out_path, arguments);
 		if (sorted == sorter_success) return EXIT_SUCCESS;
 		if (sorted == sorter_fail) return EXIT_FAILURE;
 #ifdef _DEBUG
-		if (!is_sorted(out_path, filesize))
+		if (!is_sorted(out_path, filesize) || !is_index_consistent(out_path, filesize))
 			return EXIT_FAILURE;
 #endif
 
 		std::cout << "executing...\n";
 		auto start = std::chrono::high_resolution_clock::now();
-		(*sorter)(in_path, filesize, out_path, arguments);
+		run_sorter(sorter, in_path, filesize, out_path, arguments);
 		return write_results(out_path, filesize, start);
 	} catch (std::runtime_error e) {
 		BOOST_THROW_EXCEPTION(boost::enable_error_info(e));
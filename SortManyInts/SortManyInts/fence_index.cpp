@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <boost/exception/all.hpp>
+#include "fence_index.h"
+#undef min
+#undef max
+
+namespace fs = std::filesystem;
+
+fs::path fence_index_path(const fs::path& out_path) {
+	fs::path index_path = out_path;
+	return index_path += ".idx";
+}
+
+void fence_index_writer::add(const unsigned long long* keys, std::size_t count) {
+	for (std::size_t i = 0; i < count; i++, key_count++) {
+		unsigned long long v = keys[i];
+		if (key_count % fence_block_longs == 0) {
+			entries.push_back({ v, v, v });
+		}
+		else {
+			fence_entry& block = entries.back();
+			block.min = std::min(block.min, v);
+			block.max = std::max(block.max, v);
+		}
+	}
+}
+
+void fence_index_writer::finish(const fs::path& out_path) {
+	const fs::path index_path = fence_index_path(out_path);
+	try {
+		std::ofstream out(index_path, std::ios_base::binary);
+		out.exceptions(~std::ios::goodbit);
+		fence_header header{ fence_block_longs, key_count };
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)entries.data(), entries.size() * sizeof(fence_entry));
+	}
+	catch (std::ios_base::failure e) {
+		BOOST_THROW_EXCEPTION(boost::enable_error_info(e) << boost::errinfo_file_name(index_path.string()));
+	}
+}
+
+sorted_file::sorted_file(const fs::path& out_path) {
+	const fs::path index_path = fence_index_path(out_path);
+	try {
+		index_map.open(index_path.string());
+		if (index_map.size() < sizeof(fence_header))
+			BOOST_THROW_EXCEPTION(boost::enable_error_info(std::runtime_error("fence index is truncated")) << boost::errinfo_file_name(index_path.string()));
+		header = *(const fence_header*)index_map.data();
+		entries = (const fence_entry*)(index_map.data() + sizeof(fence_header));
+		entry_count = (index_map.size() - sizeof(fence_header)) / sizeof(fence_entry);
+		if (header.block_longs == 0 || entry_count != (header.key_count + header.block_longs - 1) / header.block_longs)
+			BOOST_THROW_EXCEPTION(boost::enable_error_info(std::runtime_error("fence index is corrupt")) << boost::errinfo_file_name(index_path.string()));
+		//the index outlives the output it describes, e.g. when a sorter that doesn't emit one rewrites out_path
+		if (fs::file_size(out_path) != header.key_count * sizeof(unsigned long long))
+			BOOST_THROW_EXCEPTION(boost::enable_error_info(std::runtime_error("fence index is stale")) << boost::errinfo_file_name(index_path.string()));
+		if (header.key_count == 0) return;
+		keys_map.open(out_path.string(), header.key_count * sizeof(unsigned long long));
+		keys = (const unsigned long long*)keys_map.data();
+	}
+	catch (std::ios_base::failure e) {
+		BOOST_THROW_EXCEPTION(boost::enable_error_info(e) << boost::errinfo_file_name(out_path.string()));
+	}
+}
+
+bool sorted_file::contains(unsigned long long key) const {
+	//last block whose first key is below key, since a run of equal keys may start in the block before
+	const fence_entry* block = std::lower_bound(entries, entries + entry_count, key,
+		[](const fence_entry& e, unsigned long long k) { return e.first < k; });
+	if (block != entries && (block == entries + entry_count || block->first != key)) --block;
+	if (block == entries + entry_count || key < block->min || key > block->max)
+		return false;
+	unsigned long long begin = (block - entries) * header.block_longs;
+	unsigned long long end = std::min(begin + header.block_longs, header.key_count);
+	return std::binary_search(keys + begin, keys + end, key);
+}
+
+key_range sorted_file::range(unsigned long long lo, unsigned long long hi) const {
+	if (entry_count == 0 || lo > hi) return { keys, keys };
+	//lower bound of lo lives in the block before the first block starting at or after lo
+	const fence_entry* lo_block = std::lower_bound(entries, entries + entry_count, lo,
+		[](const fence_entry& e, unsigned long long k) { return e.first < k; });
+	if (lo_block != entries) --lo_block;
+	//upper bound of hi lives in the block before the first block starting after hi
+	const fence_entry* hi_block = std::upper_bound(entries, entries + entry_count, hi,
+		[](unsigned long long k, const fence_entry& e) { return k < e.first; });
+	if (hi_block != entries) --hi_block;
+	unsigned long long lo_begin = (lo_block - entries) * header.block_longs;
+	unsigned long long lo_end = std::min(lo_begin + header.block_longs, header.key_count);
+	unsigned long long hi_begin = (hi_block - entries) * header.block_longs;
+	unsigned long long hi_end = std::min(hi_begin + header.block_longs, header.key_count);
+	const unsigned long long* first = std::lower_bound(keys + lo_begin, keys + lo_end, lo);
+	const unsigned long long* last = std::upper_bound(keys + hi_begin, keys + hi_end, hi);
+	return { first, std::max(first, last) };
+}
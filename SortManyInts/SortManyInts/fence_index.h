@@ -0,0 +1,67 @@
+//Sparse fence index over a sorted output file, and lookups that use it.
+//Sorters whose output is sorted feed every buffer they write into a fence_index_writer, which records the first key and min/max of each
+//fence_block_longs block and writes them next to the output as <out_path>.idx, so building it costs no extra pass.
+//sorted_file maps the output and the index, so a point or range query touches one or two blocks of the output.
+//ex:
+//fence_index_writer index;
+//out.write((const char*)buffer.data(), count * sizeof(unsigned long long));
+//index.add(buffer.data(), count);
+//...
+//index.finish(out_path);
+//
+//sorted_file sorted(out_path);
+//if (sorted.contains(key)) ...
+//for (unsigned long long v : sorted.range(lo, hi)) ...
+
+#pragma once
+#include <filesystem>
+#include <vector>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+constexpr unsigned long long fence_block_longs = 64 * 1024 / sizeof(unsigned long long);
+
+struct fence_header {
+	unsigned long long block_longs;
+	unsigned long long key_count;
+};
+
+struct fence_entry {
+	unsigned long long first;
+	unsigned long long min;
+	unsigned long long max;
+};
+
+std::filesystem::path fence_index_path(const std::filesystem::path& out_path);
+
+struct fence_index_writer {
+	std::vector<fence_entry> entries;
+	unsigned long long key_count = 0;
+
+	void add(const unsigned long long* keys, std::size_t count);
+	//writes <out_path>.idx. throws std::ios_base::failure
+	void finish(const std::filesystem::path& out_path);
+};
+
+struct key_range {
+	const unsigned long long* first;
+	const unsigned long long* last;
+	const unsigned long long* begin() const { return first; }
+	const unsigned long long* end() const { return last; }
+	std::size_t size() const { return last - first; }
+	bool empty() const { return first == last; }
+};
+
+struct sorted_file {
+	boost::iostreams::mapped_file_source index_map;
+	boost::iostreams::mapped_file_source keys_map;
+	fence_header header = {};
+	const fence_entry* entries = nullptr;
+	std::size_t entry_count = 0;
+	const unsigned long long* keys = nullptr;
+
+	//throws std::runtime_error if the index is missing or doesn't match the output
+	explicit sorted_file(const std::filesystem::path& out_path);
+	bool contains(unsigned long long key) const;
+	//all keys in [lo, hi], as a view into the mapped output
+	key_range range(unsigned long long lo, unsigned long long hi) const;
+};
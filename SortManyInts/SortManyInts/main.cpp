@@ -8,12 +8,14 @@
 
 int sort_many_int_main(int argc, const char* const argv[], const std::unordered_map<std::string, sorter*>& sorters);
 sorter stubsort;
+sorter bucket;
 
 int main(int argc, const char* const argv[])
 {
 	try {
 		std::unordered_map<std::string, sorter*> sorters;
 		sorters.emplace("stubsort", &stubsort);
+		sorters.emplace("bucket", &bucket);
 		return sort_many_int_main(argc, argv, sorters);
 	}
 	catch (const std::runtime_error& e) {
@@ -0,0 +1,143 @@
+#include "numa_node.h"
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#include <windows.h>
+#undef min
+#else
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+int numa_node_count() {
+	ULONG highest_node;
+	if (!GetNumaHighestNodeNumber(&highest_node))
+		return 1;
+	return int(highest_node) + 1;
+}
+
+int numa_current_node() {
+	PROCESSOR_NUMBER processor;
+	GetCurrentProcessorNumberEx(&processor);
+	USHORT node;
+	if (!GetNumaProcessorNodeEx(&processor, &node))
+		return 0;
+	return node;
+}
+
+void numa_pin_thread(int node) {
+	if (node < 0) return;
+	GROUP_AFFINITY affinity = {};
+	if (GetNumaNodeProcessorMaskEx(USHORT(node), &affinity))
+		SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+}
+
+struct thread_affinity {
+	GROUP_AFFINITY affinity;
+};
+
+numa_thread_pin::numa_thread_pin(int node) {
+	if (node < 0) return;
+	saved = std::make_unique<thread_affinity>();
+	if (!GetThreadGroupAffinity(GetCurrentThread(), &saved->affinity)) {
+		saved.reset();
+		return;
+	}
+	numa_pin_thread(node);
+}
+
+numa_thread_pin::~numa_thread_pin() {
+	if (saved) SetThreadGroupAffinity(GetCurrentThread(), &saved->affinity, nullptr);
+}
+
+//VirtualAllocExNuma only states a preference, so a full node spills over instead of failing
+void* numa_alloc(std::size_t bytes, int node) {
+	void* p = VirtualAllocExNuma(GetCurrentProcess(), nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, DWORD(node));
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+
+void numa_free(void* p, std::size_t) {
+	VirtualFree(p, 0, MEM_RELEASE);
+}
+#else
+const int MPOL_PREFERRED_MODE = 1; //MPOL_PREFERRED from <numaif.h>, without taking a dependency on libnuma
+
+int numa_node_count() {
+	int count = 0;
+	while (std::ifstream("/sys/devices/system/node/node" + std::to_string(count) + "/cpulist"))
+		count++;
+	return count ? count : 1;
+}
+
+int numa_current_node() {
+	unsigned cpu;
+	unsigned node;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+		return 0;
+	return int(node);
+}
+
+void numa_pin_thread(int node) {
+	if (node < 0) return;
+	std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+	std::string ranges;
+	if (!std::getline(cpulist, ranges)) return;
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	std::istringstream ranges_stream(ranges);
+	std::string range;
+	while (std::getline(ranges_stream, range, ',')) {
+		if (range.empty()) continue;
+		std::size_t dash = range.find('-');
+		int first = std::stoi(range.substr(0, dash));
+		int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+		for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, &cpus);
+	}
+	sched_setaffinity(0, sizeof(cpus), &cpus);
+}
+
+struct thread_affinity {
+	cpu_set_t cpus;
+};
+
+numa_thread_pin::numa_thread_pin(int node) {
+	if (node < 0) return;
+	saved = std::make_unique<thread_affinity>();
+	if (sched_getaffinity(0, sizeof(saved->cpus), &saved->cpus) != 0) {
+		saved.reset();
+		return;
+	}
+	numa_pin_thread(node);
+}
+
+numa_thread_pin::~numa_thread_pin() {
+	if (saved) sched_setaffinity(0, sizeof(saved->cpus), &saved->cpus);
+}
+
+//preferred rather than bound: a node that fills up spills to the others, like plain heap memory would,
+//instead of sending the process into reclaim or the OOM killer
+void* numa_alloc(std::size_t bytes, int node) {
+	void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) throw std::bad_alloc();
+	unsigned long node_mask = 0;
+	//nodes past the mask width can't be expressed, so they just get first-touch placement
+	if (node >= 0 && node < int(sizeof(node_mask) * 8)) {
+		node_mask = 1ul << node;
+		//if this fails the pages also just land wherever they're first touched
+		syscall(SYS_mbind, p, bytes, MPOL_PREFERRED_MODE, &node_mask, sizeof(node_mask) * 8, 0);
+	}
+	return p;
+}
+
+void numa_free(void* p, std::size_t bytes) {
+	munmap(p, bytes);
+}
+#endif
@@ -0,0 +1,60 @@
+//NUMA placement helpers.
+//Memory from numa_allocator prefers one node, and numa_pin_thread keeps a thread on that node's processors,
+//so a thread working on a buffer doesn't pay for cross-socket traffic.
+//A node of -1 means "don't care": plain heap memory and no affinity change.
+//ex:
+//numa_vector<unsigned long long> keys{ numa_allocator<unsigned long long>(node) };
+//numa_thread_pin pin(node);
+
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+//number of NUMA nodes, or 1 if the platform doesn't report any
+int numa_node_count();
+//node of the processor the calling thread is running on right now, or 0 if the platform won't say
+int numa_current_node();
+//restricts the calling thread to the processors of node for the rest of its life. meant for threads we own
+void numa_pin_thread(int node);
+//page-granular allocation that prefers node, spilling to other nodes when it's full. throws std::bad_alloc
+void* numa_alloc(std::size_t bytes, int node);
+void numa_free(void* p, std::size_t bytes);
+
+struct thread_affinity;
+//pins the calling thread to node while in scope, then restores its previous affinity. for threads we borrow
+struct numa_thread_pin {
+	std::unique_ptr<thread_affinity> saved;
+
+	explicit numa_thread_pin(int node);
+	~numa_thread_pin();
+	numa_thread_pin(const numa_thread_pin&) = delete;
+	numa_thread_pin& operator=(const numa_thread_pin&) = delete;
+};
+
+template<class T>
+struct numa_allocator {
+	using value_type = T;
+	int node;
+
+	numa_allocator(int node = -1) noexcept : node(node) {}
+	template<class U>
+	numa_allocator(const numa_allocator<U>& other) noexcept : node(other.node) {}
+
+	T* allocate(std::size_t n) {
+		if (node < 0) return static_cast<T*>(::operator new(n * sizeof(T)));
+		return static_cast<T*>(numa_alloc(n * sizeof(T), node));
+	}
+	void deallocate(T* p, std::size_t n) {
+		if (node < 0) ::operator delete(p);
+		else numa_free(p, n * sizeof(T));
+	}
+};
+template<class T, class U>
+bool operator==(const numa_allocator<T>& l, const numa_allocator<U>& r) { return l.node == r.node; }
+template<class T, class U>
+bool operator!=(const numa_allocator<T>& l, const numa_allocator<U>& r) { return l.node != r.node; }
+
+template<class T>
+using numa_vector = std::vector<T, numa_allocator<T>>;
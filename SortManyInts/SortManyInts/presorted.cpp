@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <vector>
+#include <boost/exception/all.hpp>
+#include "async_ofilebuf.h"
+#include "fence_index.h"
+#include "sorter.h"
+#undef min
+
+namespace fs = std::filesystem;
+
+constexpr int buff_longs = 4096 * 2 / sizeof(unsigned long long);
+constexpr int probe_windows = 64;
+//runs share one file handle, so the cap is only the heap depth and the run_starts table
+constexpr unsigned long long max_merge_runs = 4096;
+//runs shorter than this on average are left to the real sorter; a heap step per key only pays off over long runs
+constexpr unsigned long long min_average_run_longs = 256;
+//a single sampled descent stands for total_longs / pairs of them, so with this few the estimate is noise.
+//random input samples tens of thousands, so letting the scan decide here costs nothing for it
+constexpr unsigned long long probe_noise_descents = 4;
+//read buffers for all runs of a merge share this budget, with at least buff_longs each
+constexpr unsigned long long merge_buffer_longs = 64 * 1024 * 1024 / sizeof(unsigned long long);
+
+enum run_direction {
+	run_ascending,
+	run_descending,
+};
+
+struct sortedness_probe {
+	unsigned long long ascents = 0;
+	unsigned long long descents = 0;
+	unsigned long long pairs = 0;
+};
+
+//reads probe_windows evenly spaced blocks and counts adjacent ascents/descents within each block.
+//this is a few dozen small reads, so it's effectively free compared to a pass over the file.
+sortedness_probe sample_sortedness(const fs::path& in_path, unsigned long long total_longs) {
+	std::ifstream in(in_path, std::ios_base::binary);
+	in.exceptions(~std::ios::goodbit);
+	unsigned long long window_longs = std::min((unsigned long long)buff_longs, total_longs);
+	std::vector<unsigned long long> buffer(window_longs);
+	sortedness_probe probe;
+	for (int i = 0; i < probe_windows; i++) {
+		unsigned long long offset = (total_longs - window_longs) * i / (probe_windows - 1);
+		in.seekg(offset * sizeof(unsigned long long));
+		in.read((char*)buffer.data(), window_longs * sizeof(unsigned long long));
+		for (unsigned long long j = 1; j < window_longs; j++) {
+			if (buffer[j - 1] < buffer[j]) probe.ascents++;
+			else if (buffer[j - 1] > buffer[j]) probe.descents++;
+		}
+		probe.pairs += window_longs - 1;
+	}
+	return probe;
+}
+
+struct dot_printer {
+	unsigned long long dot_offset;
+	unsigned long long next_dot;
+	dot_printer(unsigned long long total_longs) : dot_offset(std::max(total_longs / 79, 1ull)), next_dot(dot_offset) {}
+	void advance(unsigned long long longs_done) {
+		for (; longs_done >= next_dot; next_dot += dot_offset)
+			std::cout << '.' << std::flush;
+	}
+};
+
+//streams the whole file recording where each non-decreasing (or non-increasing) run begins.
+//while it's still a single run, each buffer is also written to copy_out (if any), so when the file turns out to be one run
+//the output is already complete and sorted input costs one read and one write, same as stubsort.
+//gives up as soon as there are more than max_runs. That bounds the cost of a bad guess from the probe to one read
+//of the file plus a write of however much of it was a single run before the first break; both are wasted if the scan
+//gives up near the end, or if a late break sends it to merge_runs, which rewrites the output from the start.
+bool find_runs(const fs::path& in_path, unsigned long long total_longs, run_direction direction, unsigned long long max_runs, std::vector<unsigned long long>& run_starts, std::ostream* copy_out, fence_index_writer* copy_index) {
+	std::ifstream in(in_path, std::ios_base::binary);
+	in.exceptions(~std::ios::goodbit);
+	std::vector<unsigned long long> buffer(buff_longs);
+	dot_printer dots(total_longs);
+	run_starts.assign(1, 0);
+	unsigned long long prev = direction == run_ascending ? 0 : ULLONG_MAX;
+	unsigned long long position = 0;
+	while (position < total_longs) {
+		unsigned long long read_count = std::min((unsigned long long)buff_longs, total_longs - position);
+		in.read((char*)buffer.data(), read_count * sizeof(unsigned long long));
+		for (unsigned long long i = 0; i < read_count; i++) {
+			unsigned long long next = buffer[i];
+			bool breaks_run = direction == run_ascending ? next < prev : next > prev;
+			if (breaks_run) {
+				if (run_starts.size() == max_runs) {
+					std::cout << '\n';
+					return false;
+				}
+				run_starts.push_back(position + i);
+			}
+			prev = next;
+		}
+		if (copy_out && run_starts.size() == 1) {
+			copy_out->write((const char*)buffer.data(), read_count * sizeof(unsigned long long));
+			copy_index->add(buffer.data(), read_count);
+		}
+		position += read_count;
+		dots.advance(position);
+	}
+	std::cout << '\n';
+	return true;
+}
+
+//reads one run through a handle shared with the other runs, seeking to its own position on every refill
+struct run_reader {
+	std::ifstream* in;
+	std::vector<unsigned long long> buffer;
+	std::size_t pos = 0;
+	unsigned long long next_long;
+	unsigned long long unread_longs;
+	unsigned long long refill_longs;
+
+	run_reader(std::ifstream& in, unsigned long long begin, unsigned long long end, unsigned long long refill_longs)
+		: in(&in)
+		, next_long(begin)
+		, unread_longs(end - begin)
+		, refill_longs(refill_longs)
+	{
+		refill();
+	}
+	bool refill() {
+		unsigned long long read_count = std::min(refill_longs, unread_longs);
+		buffer.resize(read_count);
+		in->seekg(next_long * sizeof(unsigned long long));
+		in->read((char*)buffer.data(), read_count * sizeof(unsigned long long));
+		next_long += read_count;
+		unread_longs -= read_count;
+		pos = 0;
+		return read_count != 0;
+	}
+	unsigned long long front() const { return buffer[pos]; }
+	bool pop() { return ++pos < buffer.size() || refill(); }
+};
+
+//k-way merge of the runs.  With a single run this degenerates into a buffered copy.
+void merge_runs(const fs::path& in_path, unsigned long long total_longs, const std::vector<unsigned long long>& run_starts, const fs::path& out_path) {
+	std::ifstream in(in_path, std::ios_base::binary);
+	in.exceptions(~std::ios::goodbit);
+	unsigned long long refill_longs = std::max((unsigned long long)buff_longs, merge_buffer_longs / run_starts.size());
+	std::vector<run_reader> readers;
+	readers.reserve(run_starts.size());
+	for (std::size_t i = 0; i < run_starts.size(); i++) {
+		unsigned long long end = i + 1 < run_starts.size() ? run_starts[i + 1] : total_longs;
+		readers.emplace_back(in, run_starts[i], end, refill_longs);
+	}
+	auto greater_front = [&readers](std::size_t l, std::size_t r) { return readers[l].front() > readers[r].front(); };
+	std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(greater_front)> heap(greater_front);
+	for (std::size_t i = 0; i < readers.size(); i++)
+		heap.push(i);
+
+	async_ofilebuf stream_buf(out_path.string().c_str(), std::ios_base::binary);
+	std::ostream out(&stream_buf);
+	out.exceptions(~std::ios::goodbit);
+	std::vector<unsigned long long> buffer;
+	buffer.reserve(buff_longs);
+	dot_printer dots(total_longs);
+	fence_index_writer index;
+	unsigned long long written = 0;
+	while (heap.size() > 1) {
+		std::size_t top = heap.top();
+		heap.pop();
+		buffer.push_back(readers[top].front());
+		if (readers[top].pop()) heap.push(top);
+		if (buffer.size() == buff_longs) {
+			out.write((const char*)buffer.data(), buffer.size() * sizeof(unsigned long long));
+			index.add(buffer.data(), buffer.size());
+			written += buffer.size();
+			buffer.clear();
+			dots.advance(written);
+		}
+	}
+	out.write((const char*)buffer.data(), buffer.size() * sizeof(unsigned long long));
+	index.add(buffer.data(), buffer.size());
+	written += buffer.size();
+	if (!heap.empty()) {
+		//last run standing: copy the rest of it a buffer at a time
+		run_reader& last = readers[heap.top()];
+		do {
+			std::size_t count = last.buffer.size() - last.pos;
+			out.write((const char*)(last.buffer.data() + last.pos), count * sizeof(unsigned long long));
+			index.add(last.buffer.data() + last.pos, count);
+			written += count;
+			dots.advance(written);
+		} while (last.refill());
+	}
+	std::cout << '\n';
+	index.finish(out_path);
+}
+
+//a single non-increasing run: read blocks back to front and reverse each one.
+void reverse_copy(const fs::path& in_path, unsigned long long total_longs, const fs::path& out_path) {
+	std::ifstream in(in_path, std::ios_base::binary);
+	in.exceptions(~std::ios::goodbit);
+	async_ofilebuf stream_buf(out_path.string().c_str(), std::ios_base::binary);
+	std::ostream out(&stream_buf);
+	out.exceptions(~std::ios::goodbit);
+	std::vector<unsigned long long> buffer(buff_longs);
+	dot_printer dots(total_longs);
+	fence_index_writer index;
+	unsigned long long remaining_longs = total_longs;
+	while (remaining_longs) {
+		unsigned long long read_count = std::min((unsigned long long)buff_longs, remaining_longs);
+		remaining_longs -= read_count;
+		in.seekg(remaining_longs * sizeof(unsigned long long));
+		in.read((char*)buffer.data(), read_count * sizeof(unsigned long long));
+		std::reverse(buffer.begin(), buffer.begin() + read_count);
+		out.write((const char*)buffer.data(), read_count * sizeof(unsigned long long));
+		index.add(buffer.data(), read_count);
+		dots.advance(total_longs - remaining_longs);
+	}
+	std::cout << '\n';
+	index.finish(out_path);
+}
+
+bool sort_presorted(const fs::path& in_path, unsigned long long filesize, const fs::path& out_path) {
+	try {
+		unsigned long long total_longs = filesize / sizeof(unsigned long long);
+		if (total_longs == 0) return false;
+		sortedness_probe probe = sample_sortedness(in_path, total_longs);
+		//each sampled descent suggests total_longs / pairs run breaks in the whole file
+		unsigned long long estimated_runs = probe.descents * total_longs / std::max(probe.pairs, 1ull) + 1;
+		unsigned long long run_limit = std::min(max_merge_runs, total_longs / min_average_run_longs + 1);
+		std::vector<unsigned long long> run_starts;
+		if (estimated_runs <= run_limit || probe.descents <= probe_noise_descents) {
+			std::cout << "probing " << estimated_runs << " estimated runs...\n";
+			bool found_runs;
+			{
+				async_ofilebuf stream_buf(out_path.string().c_str(), std::ios_base::binary);
+				std::ostream out(&stream_buf);
+				out.exceptions(~std::ios::goodbit);
+				fence_index_writer index;
+				found_runs = find_runs(in_path, total_longs, run_ascending, run_limit, run_starts, &out, &index);
+				if (found_runs && run_starts.size() == 1) {
+					index.finish(out_path);
+					return true;
+				}
+			}
+			if (found_runs) {
+				std::cout << "merging " << run_starts.size() << " runs...\n";
+				merge_runs(in_path, total_longs, run_starts, out_path);
+				return true;
+			}
+		}
+		if (probe.ascents == 0) {
+			std::cout << "probing reversed input...\n";
+			if (find_runs(in_path, total_longs, run_descending, 1, run_starts, nullptr, nullptr)) {
+				std::cout << "reversing...\n";
+				reverse_copy(in_path, total_longs, out_path);
+				return true;
+			}
+		}
+		return false;
+	}
+	catch (std::ios_base::failure e) {
+		BOOST_THROW_EXCEPTION(boost::enable_error_info(e) << boost::errinfo_file_name(in_path.string()));
+	}
+}
@@ -12,4 +12,7 @@ enum sorter_output {
 //returns sorted if a sort was done, or success/fail if it processed without sorting
 typedef sorter_output sorter(const std::filesystem::path& in_path, unsigned long long filesize, const std::filesystem::path& out_path, boost::program_options::variables_map& arguments);
 
+//returns true if in_path was already sorted, reverse sorted, or a few sorted runs, and has been written to out_path
+bool sort_presorted(const std::filesystem::path& in_path, unsigned long long filesize, const std::filesystem::path& out_path);
+
 long long getTotalSystemMemory();